@@ -15,10 +15,24 @@ namespace handler {
         explicit handling_error(T msg) : std::runtime_error(msg) {}
     };
 
+    // cheap prediction of how heavy the request is, made before it is queued
+    struct Estimate {
+        // abstract units of work, comparable only between requests of the same handler
+        // zero makes the request go ahead of every queued request with nonzero cost,
+        // so a handler which cannot estimate its requests should return zero for all of them
+        size_t cost = 0;
+        // bytes the handler is going to allocate while processing, zero if unknown
+        size_t memory = 0;
+    };
+
     class IHandler {
     public:
         virtual ~IHandler() = default;
         virtual auto handle(bytes_span) -> std::vector<uint8_t> = 0;
+
+        // called on the IO thread, so must not do any heavy work
+        // may throw handling_error to reject the request without queueing it
+        virtual auto inspect(bytes_span) -> Estimate { return {}; }
     };
 }
 
@@ -7,6 +7,7 @@
 
 #include "server_config.hpp"
 #include "handler_interface.hpp"
+#include "memory_budget.hpp"
 #include "util/logger.hpp"
 
 namespace server {
@@ -16,6 +17,7 @@ namespace server {
         explicit HttpServer(handler::IHandler &handler, ServerConfig config, Logger &logger)
             : config {config}
             , handler {handler}
+            , memory_budget {config.memory_limit}
             , logger {logger} {}
 
         void run();
@@ -25,6 +27,8 @@ namespace server {
         std::mutex running_mutex;
         ServerConfig config;
         handler::IHandler &handler;
+        // declared before the context, connections still left in it release leases when destroyed
+        MemoryBudget memory_budget;
         boost::asio::io_context context{};
         Logger &logger;
     };
@@ -0,0 +1,22 @@
+#ifndef MIRROR_JPEG_SERVER_JPEG_HEADER_HPP
+#define MIRROR_JPEG_SERVER_JPEG_HEADER_HPP
+
+#include "handler_interface.hpp"
+
+namespace handler {
+
+    // frame parameters taken from the SOF marker
+    struct JpegHeader {
+        unsigned width;
+        unsigned height;
+        unsigned components;
+        bool progressive;
+    };
+
+    // walks the marker segments up to the first SOF without decoding anything,
+    // so it is cheap enough to be called on the IO thread
+    // throws handling_error if input is not a JPEG or frame header is missing
+    auto parse_jpeg_header(bytes_span input_jpeg) -> JpegHeader;
+}
+
+#endif //MIRROR_JPEG_SERVER_JPEG_HEADER_HPP
@@ -0,0 +1,127 @@
+#ifndef MIRROR_JPEG_SERVER_MEMORY_BUDGET_HPP
+#define MIRROR_JPEG_SERVER_MEMORY_BUDGET_HPP
+
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <optional>
+#include <functional>
+
+namespace server {
+
+    // process-wide accountant of memory held by in-flight requests
+    // description: memory is taken as a Lease, which gives it back when destructed;
+    // those who failed to get a lease wait in a queue and are served strictly in order,
+    // so a big request cannot be starved by a stream of small ones
+    // tradeoff: strict order makes a thumbnail wait behind a huge image even if there is memory
+    // for the thumbnail right now, so small leases may bypass the queue within the bypass limit;
+    // the head of the queue is delayed by at most that much memory, and never starved,
+    // since bypassing is allowed only if the head and the memory held by waiters fit without the slice
+    // motivation: a limit per request says nothing about how much all the requests hold together
+    class MemoryBudget {
+    public:
+        class Lease {
+        public:
+            Lease(Lease &&other) noexcept
+                : budget {std::exchange(other.budget, nullptr)}
+                , bytes {other.bytes}
+                , bypassed {other.bypassed} {}
+
+            Lease &operator=(Lease &&other) noexcept {
+                if (this != &other) {
+                    if (budget != nullptr)
+                        budget->release(bytes, bypassed);
+                    budget = std::exchange(other.budget, nullptr);
+                    bytes = other.bytes;
+                    bypassed = other.bypassed;
+                }
+                return *this;
+            }
+
+            Lease(Lease&) = delete;
+
+            ~Lease() {
+                if (budget != nullptr)
+                    budget->release(bytes, bypassed);
+            }
+
+            // takes over the memory of other lease of the same budget
+            void merge(Lease &&other) {
+                bytes += other.bytes;
+                bypassed += other.bypassed;
+                other.budget = nullptr;
+            }
+
+            [[nodiscard]] size_t size() const { return bytes; }
+
+        private:
+            friend class MemoryBudget;
+            Lease(MemoryBudget &budget, size_t bytes, size_t bypassed = 0)
+                : budget {&budget}
+                , bytes {bytes}
+                , bypassed {bypassed} {}
+
+            MemoryBudget *budget;
+            size_t bytes;
+            size_t bypassed; // part of bytes taken past the queue
+        };
+
+        using ticket_type = uint64_t;
+        // gets nullopt if the waiter was rejected, see acquire_async
+        using grant_callback_type = std::function<void(std::optional<Lease>)>;
+
+        explicit MemoryBudget(size_t limit) : MemoryBudget(limit, limit / 16) {}
+
+        // bypass_limit is how much memory leases taken past the queue may hold together, 0 to disable
+        MemoryBudget(size_t limit, size_t bypass_limit)
+            : limit {limit}
+            , bypass_limit {std::min(bypass_limit, limit)} {}
+
+        MemoryBudget(MemoryBudget&) = delete;
+        MemoryBudget(MemoryBudget&&) = delete;
+
+        // fails if there is not enough memory or somebody is already waiting for it,
+        // unless the lease fits in what is left of the bypass limit
+        auto try_acquire(size_t bytes) -> std::optional<Lease>;
+
+        // queues the request for memory, callback is called once the memory is granted,
+        // right away if it fits, otherwise on the thread that releases memory, so it must not block
+        // held is how much memory the waiter already holds: if all the memory in use belongs to
+        // waiters, nobody is going to release it, and the newest waiter holding memory is rejected
+        auto acquire_async(size_t bytes, size_t held, grant_callback_type callback) -> ticket_type;
+
+        // removes the waiter from the queue, does nothing if the memory was already granted
+        void cancel(ticket_type ticket);
+
+        [[nodiscard]] size_t capacity() const { return limit; }
+
+    private:
+        struct Waiter {
+            ticket_type ticket;
+            size_t bytes;
+            size_t held;
+            grant_callback_type callback;
+        };
+
+        using grants_type = std::vector<std::pair<grant_callback_type, std::optional<Lease>>>;
+
+        void release(size_t bytes, size_t bypassed);
+        // called under the lock, callbacks are called by notify after unlocking
+        void dispatch(grants_type &grants);
+        static void notify(grants_type &grants);
+
+    private:
+        const size_t limit;
+        const size_t bypass_limit;
+        std::mutex mutex;
+        size_t used = 0;
+        size_t bypassed = 0;
+        size_t held_by_waiters = 0;
+        ticket_type next_ticket = 0;
+        std::deque<Waiter> waiters;
+    };
+}
+
+#endif //MIRROR_JPEG_SERVER_MEMORY_BUDGET_HPP
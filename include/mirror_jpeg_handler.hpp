@@ -2,10 +2,27 @@
 #define FLIP_JPEG_MIRROR_JPEG_HANDLER_HPP
 
 #include "handler_interface.hpp"
+#include "util/size_literals.hpp"
 
 namespace handler {
+
+    using namespace size_literals;
+
+    // decoded size, enough for ~85 megapixel RGB image
+    inline constexpr size_t default_max_image_size = 256_MiB;
+
     class MirrorJPEGHandler final : public IHandler {
+    public:
+        // images which would take more than max_image_size bytes when decoded are rejected
+        // before anything is allocated, so a tiny request cannot declare gigapixel dimensions
+        explicit MirrorJPEGHandler(size_t max_image_size = default_max_image_size)
+            : max_image_size {max_image_size} {}
+
         auto handle(bytes_span input_jpeg) -> std::vector<uint8_t> override;
+        auto inspect(bytes_span input_jpeg) -> Estimate override;
+
+    private:
+        const size_t max_image_size;
     };
 }
 
@@ -12,16 +12,36 @@ namespace server {
 
     inline constexpr int default_port = 17070;
     inline constexpr size_t default_max_request_size = 32_MiB; // MiB defined in size_literals.hpp
+    // request bodies, decoded images and responses of all the connections together
+    inline constexpr size_t default_memory_limit = 1_GiB;
     inline constexpr std::chrono::seconds default_timeout = std::chrono::seconds(15);
+    // roughly how many samples (width * height * components) a worker mirrors per second
+    inline constexpr size_t default_cost_per_second = 100'000'000;
+    inline constexpr unsigned default_trace_sample_rate = 100;
 
     struct ServerConfig {
         int port = default_port;
         size_t max_request_size = default_max_request_size;
+        size_t memory_limit = default_memory_limit;
         std::chrono::seconds timeout = default_timeout;
 
         struct HttpServerConfig {
             std::string_view mime_type;
         } http;
+
+        struct SchedulerConfig {
+            // lower values favour cheap requests more, higher values bring it closer to FIFO
+            // see task_scheduler.hpp
+            size_t cost_per_second = default_cost_per_second;
+        } scheduler;
+
+        struct TracingConfig {
+            // adds Server-Timing header with duration of every stage to the responses
+            bool enabled = false;
+            // if not empty, every sample_rate-th traced request is written there as Chrome trace events
+            std::string_view chrome_trace_path;
+            unsigned sample_rate = default_trace_sample_rate;
+        } tracing;
     };
 }
 
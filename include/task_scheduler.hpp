@@ -0,0 +1,62 @@
+#ifndef MIRROR_JPEG_SERVER_TASK_SCHEDULER_HPP
+#define MIRROR_JPEG_SERVER_TASK_SCHEDULER_HPP
+
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+namespace server {
+
+    // thread pool which runs the cheapest jobs first
+    // description: every job gets a virtual deadline = arrival time + cost / cost_per_second,
+    // workers always take the job with the earliest deadline
+    // motivation: a huge image shouldn't hold back hundreds of thumbnails,
+    // but it shouldn't starve either - its deadline is fixed, while new jobs arrive later and later
+    class TaskScheduler {
+        using clock = std::chrono::steady_clock;
+
+    public:
+        using job_type = std::function<void()>;
+
+        TaskScheduler(unsigned threads_count, size_t cost_per_second);
+
+        TaskScheduler(TaskScheduler&) = delete;
+        TaskScheduler(TaskScheduler&&) = delete;
+
+        // finishes already posted jobs, then joins the threads
+        ~TaskScheduler();
+
+        // jobs with the same cost are served in order of arrival,
+        // zero-cost jobs go ahead of every queued job with nonzero cost
+        void post(size_t cost, job_type job);
+
+    private:
+        struct Entry {
+            clock::time_point deadline;
+            uint64_t sequence; // keeps FIFO order among jobs with the same deadline
+            job_type job;
+
+            bool operator>(const Entry &other) const {
+                if (deadline != other.deadline)
+                    return deadline > other.deadline;
+                return sequence > other.sequence;
+            }
+        };
+
+        void worker_loop();
+
+    private:
+        const size_t cost_per_second;
+        std::mutex mutex;
+        std::condition_variable job_posted;
+        std::vector<Entry> queue; // min-heap by deadline
+        uint64_t next_sequence = 0;
+        bool stopping = false;
+        std::vector<std::thread> threads;
+    };
+}
+
+#endif //MIRROR_JPEG_SERVER_TASK_SCHEDULER_HPP
@@ -11,6 +11,10 @@ namespace size_literals {
         return 1024 * 1024 * bytes;
     }
 
+    constexpr auto operator ""_GiB(unsigned long long bytes) {
+        return 1024 * 1024 * 1024 * bytes;
+    }
+
 }
 
 #endif //FLIP_JPEG_SIZE_LITERALS_HPP
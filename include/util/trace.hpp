@@ -0,0 +1,238 @@
+#ifndef MIRROR_JPEG_SERVER_TRACE_HPP
+#define MIRROR_JPEG_SERVER_TRACE_HPP
+
+#include <mutex>
+#include <deque>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <fstream>
+#include <algorithm>
+#include <sstream>
+#include <utility>
+#include <iomanip> // std::setprecision
+#include <stdexcept>
+#include <string_view>
+#include <condition_variable>
+
+// timestamped spans of a single request
+// description: spans are added one after another as the request moves between IO and worker threads,
+// so no locking is needed; code which doesn't know about the request (e.g. handlers)
+// records into the trace installed for the current thread by Trace::Scope
+// motivation: a single "processed in" number doesn't tell where the time went
+
+class Trace {
+public:
+    using clock = std::chrono::steady_clock;
+
+    struct Span {
+        std::string_view name; // expected to be a literal
+        clock::time_point start;
+        clock::time_point end;
+        unsigned thread;
+    };
+
+    void add(std::string_view name, clock::time_point start, clock::time_point end = clock::now()) {
+        spans.push_back({name, start, end, thread_index()});
+    }
+
+    [[nodiscard]] const std::vector<Span> &get_spans() const { return spans; }
+
+    // value of Server-Timing header, e.g. "read_header;dur=1.25, decode;dur=40.1"
+    // spans with the same name (e.g. reading interrupted by waiting) are summed up
+    [[nodiscard]] std::string server_timing() const {
+        using milliseconds = std::chrono::duration<double, std::milli>;
+        std::vector<std::pair<std::string_view, clock::duration>> stages;
+        for (const auto &span : spans) {
+            auto stage = std::find_if(stages.begin(), stages.end(), [&](const auto &stage){
+                return stage.first == span.name;
+            });
+            if (stage == stages.end())
+                stages.emplace_back(span.name, span.end - span.start);
+            else
+                stage->second += span.end - span.start;
+        }
+
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(2);
+        for (const auto &[name, duration] : stages) {
+            if (name != stages.front().first)
+                out << ", ";
+            out << name << ";dur=" << milliseconds(duration).count();
+        }
+        return out.str();
+    }
+
+    // small sequential number instead of hardly readable std::thread::id
+    static unsigned thread_index() {
+        static std::atomic<unsigned> next_index {1};
+        thread_local const unsigned index = next_index++;
+        return index;
+    }
+
+    // trace the current thread works on, nullptr if the request is not traced
+    static Trace *current() {
+        return current_trace();
+    }
+
+    // installs the trace as the current one for the lifetime of the scope
+    class Scope {
+    public:
+        explicit Scope(Trace *trace) : previous {std::exchange(current_trace(), trace)} {}
+
+        Scope(Scope&) = delete;
+        Scope(Scope&&) = delete;
+
+        ~Scope() {
+            current_trace() = previous;
+        }
+
+    private:
+        Trace *previous;
+    };
+
+private:
+    static Trace *&current_trace() {
+        thread_local Trace *trace = nullptr;
+        return trace;
+    }
+
+    std::vector<Span> spans;
+};
+
+// records the span from construction till destruction
+// costs a single null check when tracing is disabled
+class TraceSpan {
+public:
+    explicit TraceSpan(std::string_view name, Trace *trace = Trace::current())
+        : trace {trace}
+        , name {name} {
+        if (trace != nullptr)
+            start = Trace::clock::now();
+    }
+
+    TraceSpan(TraceSpan&) = delete;
+    TraceSpan(TraceSpan&&) = delete;
+
+    ~TraceSpan() {
+        if (trace != nullptr)
+            trace->add(name, start);
+    }
+
+private:
+    Trace *trace;
+    std::string_view name;
+    Trace::clock::time_point start {};
+};
+
+// writes sampled traces in Chrome trace event format, to be opened by chrome://tracing or Perfetto
+// https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU
+// description: spans are written as async events with an id per request, since stages
+// of concurrent requests (e.g. reading) overlap on the same IO thread;
+// the file is written by a background thread, so the IO thread never waits for the disk;
+// if the disk can't keep up, traces are dropped instead of piling up in memory
+class ChromeTraceWriter {
+public:
+    static constexpr size_t default_max_queued = 1024;
+
+    // every sample_rate-th trace is written, 1 to write all of them
+    // max_queued is how many traces may wait for the writer thread
+    ChromeTraceWriter(const std::string &path, unsigned sample_rate, size_t max_queued = default_max_queued)
+        : max_queued {max_queued}
+        , out {path}
+        , sample_rate {sample_rate != 0 ? sample_rate : 1} {
+        if (!out)
+            throw std::runtime_error("cannot open trace file " + path);
+        out << "[";
+        writer = std::thread([this](){ writer_loop(); });
+    }
+
+    ChromeTraceWriter(ChromeTraceWriter&) = delete;
+    ChromeTraceWriter(ChromeTraceWriter&&) = delete;
+
+    // writes the traces left in the queue
+    ~ChromeTraceWriter() {
+        {
+            std::lock_guard lock {mutex};
+            stopping = true;
+        }
+        trace_posted.notify_one();
+        writer.join();
+        out << "\n]" << std::endl;
+    }
+
+    // decides whether the next trace should be written
+    bool sample() {
+        return counter++ % sample_rate == 0;
+    }
+
+    // label is shown as an argument of every span, should not contain characters escaped in JSON
+    // returns false if the trace was dropped because the queue is full
+    bool write(const Trace &trace, std::string label) {
+        {
+            std::lock_guard lock {mutex};
+            if (queue.size() >= max_queued)
+                return false;
+            queue.push_back({trace.get_spans(), std::move(label)});
+        }
+        trace_posted.notify_one();
+        return true;
+    }
+
+private:
+    struct Entry {
+        std::vector<Trace::Span> spans;
+        std::string label;
+    };
+
+    void writer_loop() {
+        uint64_t id = 0;
+        while (true) {
+            Entry entry;
+            {
+                std::unique_lock lock {mutex};
+                trace_posted.wait(lock, [this](){ return stopping || !queue.empty(); });
+                if (queue.empty())
+                    return; // stopping and nothing left to write
+                entry = std::move(queue.front());
+                queue.pop_front();
+            }
+            write_events(entry, ++id);
+        }
+    }
+
+    void write_events(const Entry &entry, uint64_t id) {
+        using microseconds = std::chrono::duration<double, std::micro>;
+        out << std::fixed << std::setprecision(3);
+        for (const auto &span : entry.spans) {
+            for (auto [phase, time] : {std::pair {'b', span.start}, std::pair {'e', span.end}}) {
+                out << (first_event ? "\n" : ",\n");
+                first_event = false;
+                out << R"({"name":")" << span.name
+                    << R"(","cat":"request","ph":")" << phase
+                    << R"(","id":)" << id
+                    << R"(,"pid":1,"tid":)" << span.thread
+                    << R"(,"ts":)" << microseconds(time - started_at).count()
+                    << R"(,"args":{"request":")" << entry.label << R"("}})";
+            }
+        }
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable trace_posted;
+    std::deque<Entry> queue;
+    const size_t max_queued;
+    bool stopping = false;
+
+    std::ofstream out; // used by the writer thread only
+    bool first_event = true;
+    const unsigned sample_rate;
+    std::atomic<unsigned> counter {0};
+    const Trace::clock::time_point started_at = Trace::clock::now();
+    std::thread writer;
+};
+
+#endif //MIRROR_JPEG_SERVER_TRACE_HPP
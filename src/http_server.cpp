@@ -8,7 +8,10 @@
 #include <boost/beast/http.hpp>
 
 #include "util/logger.hpp"
+#include "util/trace.hpp"
 #include "http_server.hpp"
+#include "task_scheduler.hpp"
+#include "memory_budget.hpp"
 
 using namespace server;
 using namespace size_literals;
@@ -23,6 +26,7 @@ namespace {
     enum TaskErrorType {
         BadRequest,
         Internal,
+        Unavailable,
     };
 
     // worker threads use these callbacks to set server response
@@ -32,13 +36,20 @@ namespace {
     };
 
     // used by Task class to enqueue requested task to worker thread
-    using enqueue_task_func_type = std::function<void(handler::bytes_span, TaskCallbacks)>;
+    // trace is nullptr if the request is not traced
+    using enqueue_task_func_type = std::function<void(handler::bytes_span, handler::Estimate, Trace*, TaskCallbacks)>;
+    // used by Task class to check the request before it is enqueued, may throw handling_error
+    using inspect_task_func_type = std::function<handler::Estimate(handler::bytes_span)>;
 
     struct TaskConfig {
         std::chrono::seconds timeout = default_timeout;
         size_t max_request_size = default_max_request_size;
         enqueue_task_func_type enqueue_task;
+        inspect_task_func_type inspect_task;
+        MemoryBudget &memory_budget;
         std::string_view mime_type;
+        bool tracing = false;
+        ChromeTraceWriter *trace_writer = nullptr; // nullptr if traces are not written
         Logger &logger;
     };
 
@@ -54,6 +65,7 @@ namespace {
             , endpoint {this->socket.remote_endpoint()}
             , timeout {this->socket.get_executor(), config.timeout}
             , enqueue_task_callback {config.enqueue_task}
+            , trace {config.tracing ? std::make_unique<Trace>() : nullptr}
             , logger {config.logger} {
 
             request_parser.body_limit(config.max_request_size);
@@ -63,7 +75,13 @@ namespace {
             auto self = shared_from_this();
             timeout.async_wait([self](boost::system::error_code ec){
                 self->socket.close();
+                // nobody uses the memory while task is parked, give it to the others
+                if (self->waiting_for_memory) {
+                    self->config.memory_budget.cancel(self->memory_ticket);
+                    self->release_memory();
+                }
             });
+            trace_stage("read_header");
             get_request();
         }
 
@@ -73,17 +91,188 @@ namespace {
         void get_request() {
             auto self = shared_from_this();
 
-            http::async_read(socket, buffer, request_parser,
-                             [self](boost::system::error_code ec, size_t){
+            // only the header is read at first, the body is not read until there is memory for it
+            http::async_read_header(socket, buffer, request_parser,
+                                    [self](boost::system::error_code ec, size_t){
+                if (ec.failed()) {
+                    self->logger.log(self->endpoint, ": error while reading request: ", ec.message());
+                    self->shutdown();
+                    return;
+                }
+                self->trace_stage("read_body");
+                self->read_body();
+            });
+        }
+
+        // reads the body piece by piece, memory is reserved before the parser allocates it
+        void read_body() {
+            if (request_parser.is_done()) {
+                trace_stage({});
+                inspect_task();
+                return;
+            }
+
+            const size_t needed = body_memory_needed();
+            if (needed > config.memory_budget.capacity()) {
+                task_failed(BadRequest, "request is too large");
+                return;
+            }
+
+            const size_t held = held_memory();
+            if (needed <= held) {
+                read_body_some();
+                return;
+            }
+            // idle connections shouldn't hold any memory
+            if (held == 0 && buffer.size() == 0 && !body_arrived) {
+                wait_for_body();
+                return;
+            }
+            acquire_memory(needed - held, "body_memory", &Task::body_memory_acquired);
+        }
+
+        // vector_body reserves the whole Content-Length at once,
+        // chunked body grows as a vector does, by at most a buffer per read
+        size_t body_memory_needed() {
+            if (auto length = request_parser.content_length())
+                return std::min<uint64_t>(*length, config.max_request_size);
+            const auto &body = request_parser.get().body();
+            return std::max(body.capacity(), 2 * (body.size() + buffer.max_size()));
+        }
+
+        // non blocking
+        void wait_for_body() {
+            auto self = shared_from_this();
+
+            socket.async_wait(tcp::socket::wait_read, [self](boost::system::error_code ec){
                 if (ec.failed()) {
                     self->logger.log(self->endpoint, ": error while reading request: ", ec.message());
                     self->shutdown();
                     return;
                 }
-                self->enqueue_task();
+                self->body_arrived = true;
+                self->read_body();
             });
         }
 
+        void body_memory_acquired(MemoryBudget::Lease lease) {
+            if (body_memory)
+                body_memory->merge(std::move(lease));
+            else
+                body_memory.emplace(std::move(lease));
+            read_body_some();
+        }
+
+        // non blocking
+        void read_body_some() {
+            auto self = shared_from_this();
+
+            http::async_read_some(socket, buffer, request_parser,
+                                  [self](boost::system::error_code ec, size_t){
+                if (ec.failed()) {
+                    self->logger.log(self->endpoint, ": error while reading request: ", ec.message());
+                    self->shutdown();
+                    return;
+                }
+                self->read_body();
+            });
+        }
+
+        void inspect_task() {
+            handler::bytes_span body {
+                request_parser.get().body()
+            };
+
+            try {
+                TraceSpan span {"inspect", trace.get()};
+                // cheap check on the IO thread, so broken requests don't wait in the queue
+                estimate = config.inspect_task(body);
+            } catch (handler::handling_error &e) {
+                task_failed(BadRequest, e.what());
+                return;
+            } catch (std::exception &e) {
+                logger.log(Logger::Error, "internal error: ", e.what());
+                task_failed(Internal, "internal server error");
+                return;
+            }
+
+            if (estimate.memory + held_memory() > config.memory_budget.capacity()) {
+                task_failed(BadRequest, "image is too large");
+                return;
+            }
+            // memory for decoded image and the response, held until the response is sent
+            acquire_memory(estimate.memory, "processing_memory", &Task::processing_memory_acquired);
+        }
+
+        void processing_memory_acquired(MemoryBudget::Lease lease) {
+            processing_memory.emplace(std::move(lease));
+            enqueue_task();
+        }
+
+        // stops any IO with the client until the memory is granted, then calls on_acquired
+        // time spent waiting is traced as wait_stage
+        void acquire_memory(size_t bytes, std::string_view wait_stage,
+                            void (Task::*on_acquired)(MemoryBudget::Lease)) {
+            if (auto lease = config.memory_budget.try_acquire(bytes)) {
+                ((*this).*on_acquired)(std::move(*lease));
+                return;
+            }
+
+            logger.log(Logger::Debug, endpoint, ": waiting for memory");
+            waiting_for_memory = true;
+            stage_after_wait = stage;
+            trace_stage(wait_stage);
+
+            auto self = shared_from_this();
+            auto on_granted = [self, on_acquired](std::optional<MemoryBudget::Lease> lease){
+                // called from the thread which released the memory
+                boost::asio::post(self->socket.get_executor(),
+                                  [self, on_acquired, lease = std::move(lease)]() mutable {
+                    self->memory_granted(on_acquired, std::move(lease));
+                });
+            };
+            memory_ticket = config.memory_budget.acquire_async(bytes, held_memory(), on_granted);
+        }
+
+        void memory_granted(void (Task::*on_acquired)(MemoryBudget::Lease), std::optional<MemoryBudget::Lease> lease) {
+            waiting_for_memory = false;
+            if (!socket.is_open()) {
+                logger.log(endpoint, ": timed out while waiting for memory");
+                shutdown();
+                return;
+            }
+            if (!lease) {
+                // rejected to break the deadlock, the others need our memory
+                release_memory();
+                task_failed(Unavailable, "server is overloaded, try again later");
+                return;
+            }
+            trace_stage(stage_after_wait);
+            ((*this).*on_acquired)(std::move(*lease));
+        }
+
+        // finishes the span of the current stage and starts the next one, empty name to start none
+        // stages are traced this way when they are spread over several callbacks
+        void trace_stage(std::string_view next) {
+            if (!trace)
+                return;
+            const auto now = Trace::clock::now();
+            if (!stage.empty())
+                trace->add(stage, stage_started, now);
+            stage = next;
+            stage_started = now;
+        }
+
+        size_t held_memory() const {
+            return (body_memory ? body_memory->size() : 0)
+                 + (processing_memory ? processing_memory->size() : 0);
+        }
+
+        void release_memory() {
+            processing_memory.reset();
+            body_memory.reset();
+        }
+
         void enqueue_task() {
             auto self = shared_from_this();
 
@@ -101,7 +290,7 @@ namespace {
             };
 
             enqueued_at = clock::now();
-            enqueue_task_callback(body, callbacks);
+            enqueue_task_callback(body, estimate, trace.get(), callbacks);
         }
 
         void task_succeed(std::vector<uint8_t> response_data) {
@@ -112,7 +301,7 @@ namespace {
             if (!config.mime_type.empty())
                 response.set(http::field::content_type, config.mime_type);
             response.body() = std::move(response_data);
-            response.prepare_payload(); // set Content-Length etc
+            prepare_response();
             send_response();
         }
 
@@ -123,28 +312,58 @@ namespace {
                 response.result(http::status::internal_server_error);
             else if (type == BadRequest)
                 response.result(http::status::bad_request);
+            else if (type == Unavailable)
+                response.result(http::status::service_unavailable);
 
             response.set(http::field::content_type, "text/plain");
             response.body() = std::vector<uint8_t>(message.size() + 1 /* for newline*/);
             std::copy(message.begin(), message.end(), response.body().begin());
             response.body().push_back(static_cast<uint8_t>('\n'));
 
-            response.prepare_payload(); // set Content-Length etc
+            prepare_response();
             send_response();
         }
 
+        void prepare_response() {
+            // spans after this point (i.e. writing) get only to the trace file
+            if (trace) {
+                trace_stage({}); // the request might have failed in the middle of a stage
+                response.set("Server-Timing", trace->server_timing());
+            }
+            response.prepare_payload(); // set Content-Length etc
+        }
+
         // non blocking
         void send_response() {
             auto self = shared_from_this();
 
+            Trace::clock::time_point write_started {};
+            if (trace)
+                write_started = Trace::clock::now();
+
             http::async_write(socket, response,
-                              [self](boost::system::error_code ec, size_t){
+                              [self, write_started](boost::system::error_code ec, size_t){
                 if (ec.failed())
                     self->logger.log(self->endpoint, ": error while sending response: ", ec.message());
+                if (self->trace) {
+                    self->trace->add("write", write_started);
+                    self->write_trace();
+                }
                 self->shutdown();
             });
         }
 
+        void write_trace() {
+            auto writer = config.trace_writer;
+            if (writer == nullptr || !writer->sample())
+                return;
+            std::ostringstream label;
+            label << endpoint;
+            // copies the spans, the file is written by the writer thread
+            if (!writer->write(*trace, label.str()))
+                logger.log(Logger::Debug, endpoint, ": trace dropped, writer is behind");
+        }
+
         void shutdown() {
             logger.log(Logger::Debug, endpoint, ": closing connection");
 
@@ -156,6 +375,8 @@ namespace {
             socket.shutdown(boost::asio::socket_base::shutdown_both, ec);
             if (ec.failed())
                 logger.log(Logger::Debug, endpoint, ": shutdown error: ", ec.message());
+
+            release_memory();
         }
 
     private:
@@ -166,6 +387,18 @@ namespace {
         boost::asio::steady_timer timeout;
         enqueue_task_func_type enqueue_task_callback;
         std::chrono::time_point<clock> enqueued_at {};
+        handler::Estimate estimate {};
+
+        std::optional<MemoryBudget::Lease> body_memory;
+        std::optional<MemoryBudget::Lease> processing_memory;
+        bool waiting_for_memory = false;
+        MemoryBudget::ticket_type memory_ticket = 0;
+        bool body_arrived = false;
+
+        std::unique_ptr<Trace> trace; // nullptr if tracing is disabled
+        std::string_view stage; // current stage traced by trace_stage, empty if none
+        std::string_view stage_after_wait;
+        Trace::clock::time_point stage_started {};
 
         boost::beast::flat_buffer buffer { 4_KiB }; // used for reading request
         http::request_parser<http::vector_body<uint8_t>> request_parser;
@@ -203,10 +436,29 @@ void HttpServer::run() {
 
     const unsigned cpu_threads_count = std::thread::hardware_concurrency();
     const unsigned num_threads = cpu_threads_count != 0 ? cpu_threads_count : default_threads_count;
-    boost::asio::thread_pool pool(num_threads);
+    std::unique_ptr<ChromeTraceWriter> trace_writer;
+    if (config.tracing.enabled && !config.tracing.chrome_trace_path.empty()) {
+        trace_writer = std::make_unique<ChromeTraceWriter>(std::string(config.tracing.chrome_trace_path),
+                                                           config.tracing.sample_rate);
+    }
 
-    auto enqueue_task_callback = [this, &pool](handler::bytes_span request, TaskCallbacks callback){
-        boost::asio::post(pool, [this, request, callback=std::move(callback)](){
+    TaskScheduler scheduler(num_threads, config.scheduler.cost_per_second);
+
+    auto enqueue_task_callback = [this, &scheduler](handler::bytes_span request, handler::Estimate estimate,
+                                                    Trace *trace, TaskCallbacks callback){
+        Trace::clock::time_point posted_at {};
+        if (trace)
+            posted_at = Trace::clock::now();
+
+        // the job keeps the context running, so the final context.run() in the shutdown
+        // doesn't return while there are queued jobs whose responses are not written yet
+        auto work = boost::asio::make_work_guard(context);
+
+        scheduler.post(estimate.cost, [this, request, trace, posted_at, work, callback=std::move(callback)](){
+            if (trace)
+                trace->add("queue", posted_at);
+            // spans of the handler are recorded to the trace of this request
+            Trace::Scope trace_scope {trace};
             try {
                 auto result = handler.handle(request);
                 callback.success(result);
@@ -219,11 +471,19 @@ void HttpServer::run() {
         });
     };
 
+    auto inspect_task_callback = [this](handler::bytes_span request){
+        return handler.inspect(request);
+    };
+
     TaskConfig taskConfig {
         .timeout = config.timeout,
         .max_request_size = config.max_request_size,
         .enqueue_task = enqueue_task_callback,
+        .inspect_task = inspect_task_callback,
+        .memory_budget = memory_budget,
         .mime_type = config.http.mime_type,
+        .tracing = config.tracing.enabled,
+        .trace_writer = trace_writer.get(),
         .logger = logger
     };
 
@@ -248,11 +508,12 @@ void HttpServer::run() {
     acceptor.close();
 
     // then serve the others
-    // (context.run() will return when all the work was finished)
+    // (context.run() will return when all the work was finished,
+    // including the queued jobs, see enqueue_task_callback)
     context.restart();
     context.run();
 
-    // threads will be stopped and joined by thread.pool destructor
+    // scheduler has nothing to do at this point, its destructor just joins the threads
 }
 
 void HttpServer::stop() {
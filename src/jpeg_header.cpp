@@ -0,0 +1,84 @@
+#include "jpeg_header.hpp"
+
+using namespace handler;
+
+namespace {
+    // https://www.w3.org/Graphics/JPEG/itu-t81.pdf, table B.1
+    constexpr uint8_t marker_prefix = 0xFF;
+    constexpr uint8_t SOI = 0xD8;
+    constexpr uint8_t EOI = 0xD9;
+    constexpr uint8_t SOS = 0xDA;
+    constexpr uint8_t TEM = 0x01;
+    constexpr uint8_t RST0 = 0xD0;
+    constexpr uint8_t RST7 = 0xD7;
+
+    // SOF0..SOF15 except DHT (C4), JPG (C8) and DAC (CC)
+    bool is_start_of_frame(uint8_t marker) {
+        return marker >= 0xC0 && marker <= 0xCF
+            && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+    }
+
+    // SOF2, SOF6, SOF10 and SOF14
+    bool is_progressive(uint8_t marker) {
+        return (marker & 0x03) == 0x02;
+    }
+
+    // markers without length field
+    bool is_standalone(uint8_t marker) {
+        return marker == TEM || (marker >= RST0 && marker <= RST7);
+    }
+
+    unsigned read_u16(const uint8_t *data) {
+        return (data[0] << 8) | data[1];
+    }
+}
+
+auto handler::parse_jpeg_header(bytes_span input_jpeg) -> JpegHeader {
+    const uint8_t *data = input_jpeg.data();
+    const size_t size = input_jpeg.size();
+
+    if (size < 2 || data[0] != marker_prefix || data[1] != SOI)
+        throw handling_error("not valid jpeg format");
+
+    size_t pos = 2;
+    while (pos < size) {
+        // libjpeg skips garbage between segments with a warning, so do we
+        while (pos < size && data[pos] != marker_prefix)
+            pos++;
+        // any marker may be preceded by fill bytes
+        while (pos < size && data[pos] == marker_prefix)
+            pos++;
+        if (pos >= size)
+            break;
+
+        const uint8_t marker = data[pos++];
+        if (is_standalone(marker))
+            continue;
+        if (marker == SOS || marker == EOI)
+            throw handling_error("not valid jpeg format: no frame header");
+
+        if (pos + 2 > size)
+            break;
+        const unsigned length = read_u16(data + pos); // includes the length field itself
+        if (length < 2 || pos + length > size)
+            break;
+
+        if (is_start_of_frame(marker)) {
+            // precision (1), height (2), width (2), components (1)
+            if (length < 8)
+                throw handling_error("not valid jpeg format: frame header is too short");
+            const uint8_t *frame = data + pos + 2;
+            JpegHeader header {
+                .width = read_u16(frame + 3),
+                .height = read_u16(frame + 1),
+                .components = frame[5],
+                .progressive = is_progressive(marker)
+            };
+            if (header.width == 0 || header.height == 0 || header.components == 0)
+                throw handling_error("not valid jpeg format: empty frame");
+            return header;
+        }
+        pos += length;
+    }
+    throw handling_error("not valid jpeg format: unexpected end of data");
+}
@@ -0,0 +1,104 @@
+#include <algorithm>
+
+#include "memory_budget.hpp"
+
+using namespace server;
+
+auto MemoryBudget::try_acquire(size_t bytes) -> std::optional<Lease> {
+    std::lock_guard lock {mutex};
+    if (bytes > limit - used)
+        return std::nullopt;
+    if (waiters.empty()) {
+        used += bytes;
+        return Lease {*this, bytes};
+    }
+
+    // the head must fit along with the memory of the waiters, which is not going to be released,
+    // without the bypass slice: then it is granted as soon as the others release their leases,
+    // and a deadlock of the waiters is still detected, see dispatch
+    if (bytes > bypass_limit - bypassed
+        || waiters.front().bytes > limit - bypass_limit
+        || held_by_waiters > limit - bypass_limit - waiters.front().bytes)
+        return std::nullopt;
+    used += bytes;
+    bypassed += bytes;
+    return Lease {*this, bytes, bytes};
+}
+
+auto MemoryBudget::acquire_async(size_t bytes, size_t held, grant_callback_type callback) -> ticket_type {
+    grants_type grants;
+    ticket_type ticket;
+    {
+        std::lock_guard lock {mutex};
+        ticket = next_ticket++;
+        waiters.push_back({ticket, bytes, held, std::move(callback)});
+        held_by_waiters += held;
+        // granted right away if it fits, so there is no gap to miss a release in
+        dispatch(grants);
+    }
+    notify(grants);
+    return ticket;
+}
+
+void MemoryBudget::cancel(ticket_type ticket) {
+    grants_type grants;
+    grant_callback_type cancelled; // destroyed outside the lock, may own the last reference to the waiter
+    {
+        std::lock_guard lock {mutex};
+        auto waiter = std::find_if(waiters.begin(), waiters.end(), [ticket](const Waiter &waiter){
+            return waiter.ticket == ticket;
+        });
+        if (waiter == waiters.end())
+            return;
+        held_by_waiters -= waiter->held;
+        cancelled = std::move(waiter->callback);
+        waiters.erase(waiter);
+        // the next ones might fit now
+        dispatch(grants);
+    }
+    notify(grants);
+}
+
+void MemoryBudget::release(size_t bytes, size_t bypassed_bytes) {
+    grants_type grants;
+    {
+        std::lock_guard lock {mutex};
+        used -= bytes;
+        bypassed -= bypassed_bytes;
+        dispatch(grants);
+    }
+    notify(grants);
+}
+
+void MemoryBudget::dispatch(grants_type &grants) {
+    while (!waiters.empty()) {
+        Waiter &head = waiters.front();
+        if (head.bytes <= limit - used) {
+            used += head.bytes;
+            held_by_waiters -= head.held;
+            grants.emplace_back(std::move(head.callback), Lease {*this, head.bytes});
+            waiters.pop_front();
+            continue;
+        }
+
+        // somebody who doesn't wait will release memory sooner or later
+        if (used != held_by_waiters)
+            return;
+
+        // deadlock: all the memory belongs to the waiters,
+        // reject the newest one whose memory would be released
+        auto victim = std::find_if(waiters.rbegin(), waiters.rend(), [](const Waiter &waiter){
+            return waiter.held != 0;
+        });
+        // nobody holds anything, so the head would never fit
+        auto rejected = victim != waiters.rend() ? std::prev(victim.base()) : waiters.begin();
+        held_by_waiters -= rejected->held;
+        grants.emplace_back(std::move(rejected->callback), std::nullopt);
+        waiters.erase(rejected);
+    }
+}
+
+void MemoryBudget::notify(grants_type &grants) {
+    for (auto &[callback, lease] : grants)
+        callback(std::move(lease));
+}
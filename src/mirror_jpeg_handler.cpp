@@ -9,8 +9,10 @@ extern "C" {
 }
 
 #include "mirror_jpeg_handler.hpp"
+#include "jpeg_header.hpp"
 #include "util/size_literals.hpp"
 #include "util/scope_guard.hpp"
+#include "util/trace.hpp"
 
 using namespace handler;
 using namespace size_literals;
@@ -23,16 +25,47 @@ struct Jpeg {
     J_COLOR_SPACE colorspace;
 };
 
-Jpeg decompress_jpeg(bytes_span compressed);
+Jpeg decompress_jpeg(bytes_span compressed, size_t max_image_size);
 std::vector<uint8_t> compress_jpeg(Jpeg &image);
 static void mirror_image(Jpeg &image);
 
+constexpr auto output_block_size = 32_KiB;
+
 auto MirrorJPEGHandler::handle(bytes_span input_jpeg) -> std::vector<uint8_t> {
-    Jpeg image = decompress_jpeg(input_jpeg);
-    mirror_image(image);
+    Jpeg image = [&](){
+        TraceSpan span {"decode"};
+        return decompress_jpeg(input_jpeg, max_image_size);
+    }();
+    {
+        TraceSpan span {"mirror"};
+        mirror_image(image);
+    }
+    TraceSpan span {"encode"};
     return compress_jpeg(image);
 }
 
+auto MirrorJPEGHandler::inspect(bytes_span input_jpeg) -> Estimate {
+    const JpegHeader header = parse_jpeg_header(input_jpeg);
+    const size_t image_size = size_t{header.width} * header.height * header.components;
+    if (image_size > max_image_size)
+        throw handling_error("image is too large");
+
+    // decoding and encoding time grows roughly with the number of samples,
+    // progressive images need several passes over coefficients to decode
+    size_t cost = image_size;
+    if (header.progressive)
+        cost *= 2;
+
+    // decoded frame plus the output, re-encoding with default quality rarely
+    // makes it more than twice bigger than the input
+    size_t memory = image_size + 2 * input_jpeg.size() + output_block_size;
+    // progressive decoder keeps all the DCT coefficients in memory
+    if (header.progressive)
+        memory += image_size * sizeof(JCOEF);
+
+    return {.cost = cost, .memory = memory};
+}
+
 static void mirror_image(Jpeg &image) {
     uint8_t *image_data = image.buffer.data();
     for (unsigned current_row = 0; current_row < image.height; current_row++) {
@@ -58,7 +91,7 @@ static void mirror_image(Jpeg &image) {
 
 static std::string get_error_message(j_common_ptr err_info);
 
-Jpeg decompress_jpeg(bytes_span compressed) {
+Jpeg decompress_jpeg(bytes_span compressed, size_t max_image_size) {
 
     jpeg_decompress_struct info {};
     scope_guard info_destructor([&](){
@@ -82,6 +115,11 @@ Jpeg decompress_jpeg(bytes_span compressed) {
     if (jpeg_read_header(&info, true /* error if EOF encountered */) != JPEG_HEADER_OK)
         throw handling_error("not valid jpeg format");
 
+    // checked before jpeg_start_decompress, which already allocates buffers for the frame
+    const size_t image_size = size_t{info.image_width} * info.image_height * info.num_components;
+    if (image_size > max_image_size)
+        throw handling_error("image is too large");
+
     jpeg_start_decompress(&info);
 
     const unsigned width = info.output_width;
@@ -134,7 +172,7 @@ std::vector<uint8_t> compress_jpeg(Jpeg &image) {
     jpeg_set_defaults(&info);
 
     std::vector<uint8_t> buffer;
-    constexpr auto block_size = 32_KiB;
+    constexpr auto block_size = output_block_size;
 
     // 1. library does it the same way
     // https://github.com/LuaDist/libjpeg/blob/6c0fcb8ddee365e7abc4d332662b06900612e923/jdatadst.c#L235
@@ -0,0 +1,63 @@
+#include <algorithm>
+
+#include "task_scheduler.hpp"
+
+using namespace server;
+
+// a job this expensive is late anyway, the exact deadline doesn't matter
+constexpr std::chrono::hours max_delay {1};
+
+TaskScheduler::TaskScheduler(unsigned threads_count, size_t cost_per_second)
+    : cost_per_second {std::max<size_t>(cost_per_second, 1)} {
+
+    threads.reserve(threads_count);
+    for (unsigned i = 0; i < threads_count; i++)
+        threads.emplace_back([this](){ worker_loop(); });
+}
+
+TaskScheduler::~TaskScheduler() {
+    {
+        std::lock_guard lock {mutex};
+        stopping = true;
+    }
+    job_posted.notify_all();
+    for (auto &thread : threads)
+        thread.join();
+}
+
+void TaskScheduler::post(size_t cost, job_type job) {
+    using nanoseconds = std::chrono::nanoseconds;
+    // long double to avoid overflow for absurdly large costs, which are clamped before
+    // converting back: neither the conversion nor now() + delay may overflow
+    const long double delay_ns = std::min<long double>(
+            static_cast<long double>(cost) * std::nano::den / cost_per_second,
+            nanoseconds(max_delay).count());
+    const auto delay = nanoseconds(static_cast<nanoseconds::rep>(delay_ns));
+
+    {
+        std::lock_guard lock {mutex};
+        queue.push_back({
+            .deadline = clock::now() + delay,
+            .sequence = next_sequence++,
+            .job = std::move(job)
+        });
+        std::push_heap(queue.begin(), queue.end(), std::greater<>{});
+    }
+    job_posted.notify_one();
+}
+
+void TaskScheduler::worker_loop() {
+    while (true) {
+        job_type job;
+        {
+            std::unique_lock lock {mutex};
+            job_posted.wait(lock, [this](){ return stopping || !queue.empty(); });
+            if (queue.empty())
+                return; // stopping and nothing left to do
+            std::pop_heap(queue.begin(), queue.end(), std::greater<>{});
+            job = std::move(queue.back().job);
+            queue.pop_back();
+        }
+        job();
+    }
+}
@@ -0,0 +1,144 @@
+#define BOOST_TEST_MODULE http_server_shutdown
+#include <boost/test/included/unit_test.hpp>
+
+#include <mutex>
+#include <future>
+#include <thread>
+#include <sstream>
+#include <condition_variable>
+
+#define BOOST_BEAST_USE_STD_STRING_VIEW
+#include <boost/beast.hpp>
+
+#include "http_server.hpp"
+#include "util/logger.hpp"
+
+namespace http = boost::beast::http;
+using tcp = boost::asio::ip::tcp;
+using namespace size_literals;
+using namespace std::chrono_literals;
+
+namespace {
+    constexpr int test_port = 17071;
+    constexpr unsigned clients_count = 8;
+
+    // echoes the request back, but only after the gate is opened,
+    // so the test decides when the queued jobs are finished
+    class GatedEchoHandler final : public handler::IHandler {
+    public:
+        auto handle(handler::bytes_span input) -> std::vector<uint8_t> override {
+            std::unique_lock lock {mutex};
+            changed.wait(lock, [this](){ return gate_open; });
+            handled++;
+            return {input.begin(), input.end()};
+        }
+
+        auto inspect(handler::bytes_span input) -> handler::Estimate override {
+            {
+                std::lock_guard lock {mutex};
+                inspected++;
+            }
+            changed.notify_all();
+            return {.cost = input.size(), .memory = 2 * input.size()};
+        }
+
+        // inspect is followed by enqueueing the job on the same IO thread
+        bool wait_inspected(unsigned count, std::chrono::seconds timeout) {
+            std::unique_lock lock {mutex};
+            return changed.wait_for(lock, timeout, [&](){ return inspected >= count; });
+        }
+
+        void open_gate() {
+            {
+                std::lock_guard lock {mutex};
+                gate_open = true;
+            }
+            changed.notify_all();
+        }
+
+        unsigned get_handled() {
+            std::lock_guard lock {mutex};
+            return handled;
+        }
+
+    private:
+        std::mutex mutex;
+        std::condition_variable changed;
+        bool gate_open = false;
+        unsigned inspected = 0;
+        unsigned handled = 0;
+    };
+
+    // returns the status code, or 0 if the server closed the connection without a response
+    unsigned send_request(const std::vector<uint8_t> &body) {
+        try {
+            boost::asio::io_context context;
+            tcp::socket socket {context};
+            // the server might not be accepting yet
+            for (unsigned attempt = 0;; attempt++) {
+                boost::system::error_code ec;
+                socket.connect({boost::asio::ip::address_v4::loopback(), test_port}, ec);
+                if (!ec)
+                    break;
+                if (attempt == 100)
+                    return 0;
+                socket.close();
+                std::this_thread::sleep_for(50ms);
+            }
+            // don't wait forever for a server which got stuck
+            timeval io_timeout {.tv_sec = 30, .tv_usec = 0};
+            setsockopt(socket.native_handle(), SOL_SOCKET, SO_SNDTIMEO, &io_timeout, sizeof(io_timeout));
+            setsockopt(socket.native_handle(), SOL_SOCKET, SO_RCVTIMEO, &io_timeout, sizeof(io_timeout));
+
+            http::request<http::vector_body<uint8_t>> request {http::verb::post, "/", 11};
+            request.body() = body;
+            request.prepare_payload();
+            http::write(socket, request);
+
+            boost::beast::flat_buffer buffer;
+            http::response<http::vector_body<uint8_t>> response;
+            http::read(socket, buffer, response);
+            return response.result_int();
+        } catch (std::exception &) {
+            return 0;
+        }
+    }
+}
+
+// connections whose jobs are still queued when the server is stopped and whose sockets
+// are closed by the timeout must not outlive the server: run() returns only after
+// all the queued jobs are finished
+BOOST_AUTO_TEST_CASE(stop_with_queued_jobs) {
+    std::ostringstream log;
+    Logger logger {log};
+    GatedEchoHandler handler;
+    server::HttpServer server {handler, server::ServerConfig {
+        .port = test_port,
+        .memory_limit = 64_MiB,
+        .timeout = std::chrono::seconds(2),
+    }, logger};
+
+    unsigned handled_when_returned = 0;
+    std::thread server_thread([&](){
+        server.run();
+        handled_when_returned = handler.get_handled();
+    });
+
+    const std::vector<uint8_t> body(64_KiB, 0x42);
+    std::vector<std::future<unsigned>> clients;
+    for (unsigned i = 0; i < clients_count; i++)
+        clients.push_back(std::async(std::launch::async, send_request, std::cref(body)));
+
+    const bool all_queued = handler.wait_inspected(clients_count, 30s);
+    server.stop();
+
+    // the gate is closed, so no response is written before the timeout closes the connections
+    for (auto &client : clients)
+        BOOST_CHECK_EQUAL(client.get(), 0u);
+
+    handler.open_gate();
+    server_thread.join();
+
+    BOOST_REQUIRE(all_queued);
+    BOOST_CHECK_EQUAL(handled_when_returned, clients_count);
+}
@@ -0,0 +1,93 @@
+#define BOOST_TEST_MODULE jpeg_header
+#include <boost/test/included/unit_test.hpp>
+
+#include <string>
+#include <vector>
+#include <optional>
+
+#include "jpeg_header.hpp"
+
+namespace {
+    using bytes = std::vector<uint8_t>;
+
+    bytes operator+(bytes lhs, const bytes &rhs) {
+        lhs.insert(lhs.end(), rhs.begin(), rhs.end());
+        return lhs;
+    }
+
+    const bytes soi = {0xFF, 0xD8};
+    const bytes eoi = {0xFF, 0xD9};
+    const bytes sos = {0xFF, 0xDA, 0x00, 0x02};
+
+    // marker segment with the payload of given size, filled with zeroes
+    bytes segment(uint8_t marker, size_t payload_size) {
+        const size_t length = payload_size + 2;
+        bytes result = {0xFF, marker, uint8_t(length >> 8), uint8_t(length & 0xFF)};
+        result.resize(result.size() + payload_size, 0);
+        return result;
+    }
+
+    bytes frame(uint8_t marker, unsigned width, unsigned height, unsigned components) {
+        bytes result = segment(marker, 6 + 3 * components);
+        result[5] = uint8_t(height >> 8);
+        result[6] = uint8_t(height & 0xFF);
+        result[7] = uint8_t(width >> 8);
+        result[8] = uint8_t(width & 0xFF);
+        result[9] = uint8_t(components);
+        return result;
+    }
+
+    const bytes app0 = segment(0xE0, 14);
+    const bytes baseline = frame(0xC0, 640, 480, 3);
+
+    struct Case {
+        std::string name;
+        bytes input;
+        std::optional<handler::JpegHeader> expected; // nullopt if handling_error is expected
+    };
+
+    const handler::JpegHeader baseline_header {.width = 640, .height = 480, .components = 3, .progressive = false};
+
+    const std::vector<Case> cases = {
+        {"baseline", soi + app0 + baseline + sos + eoi, baseline_header},
+        {"fill bytes before marker", soi + app0 + bytes {0xFF, 0xFF, 0xFF} + baseline, baseline_header},
+        {"garbage between segments", soi + app0 + bytes {0x00, 0x12, 0x34} + baseline, baseline_header},
+        {"standalone marker before frame", soi + bytes {0xFF, 0xD0} + baseline, baseline_header},
+        {"progressive", soi + frame(0xC2, 100, 200, 1),
+            handler::JpegHeader {.width = 100, .height = 200, .components = 1, .progressive = true}},
+        {"DHT is not a frame", soi + segment(0xC4, 4) + baseline, baseline_header},
+        {"JPG is not a frame", soi + segment(0xC8, 4) + baseline, baseline_header},
+        {"DAC is not a frame", soi + segment(0xCC, 4) + baseline, baseline_header},
+
+        {"empty body", {}, std::nullopt},
+        {"not a jpeg", {'G', 'I', 'F', '8', '9', 'a'}, std::nullopt},
+        {"only start of image", soi, std::nullopt},
+        {"truncated segment length", soi + bytes {0xFF, 0xE0, 0x00}, std::nullopt},
+        {"segment past the end", soi + bytes {0xFF, 0xE0, 0x00, 0x10, 0x00}, std::nullopt},
+        {"segment length below 2", soi + bytes {0xFF, 0xE0, 0x00, 0x01} + baseline, std::nullopt},
+        {"truncated frame", soi + bytes {0xFF, 0xC0, 0x00, 0x06, 0x08, 0x01, 0xE0, 0x02}, std::nullopt},
+        {"zero width", soi + frame(0xC0, 0, 480, 3), std::nullopt},
+        {"zero height", soi + frame(0xC0, 640, 0, 3), std::nullopt},
+        {"zero components", soi + frame(0xC0, 640, 480, 0), std::nullopt},
+        {"scan before frame", soi + app0 + sos + baseline, std::nullopt},
+        {"end of image before frame", soi + app0 + eoi + baseline, std::nullopt},
+    };
+}
+
+BOOST_AUTO_TEST_CASE(parse_jpeg_header) {
+    for (const auto &[name, input, expected] : cases) {
+        BOOST_TEST_CONTEXT(name) {
+            bytes copy = input;
+            handler::bytes_span span {copy.data(), copy.size()};
+            if (!expected) {
+                BOOST_CHECK_THROW(handler::parse_jpeg_header(span), handler::handling_error);
+                continue;
+            }
+            const auto header = handler::parse_jpeg_header(span);
+            BOOST_CHECK_EQUAL(header.width, expected->width);
+            BOOST_CHECK_EQUAL(header.height, expected->height);
+            BOOST_CHECK_EQUAL(header.components, expected->components);
+            BOOST_CHECK_EQUAL(header.progressive, expected->progressive);
+        }
+    }
+}
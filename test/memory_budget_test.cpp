@@ -0,0 +1,132 @@
+#define BOOST_TEST_MODULE memory_budget
+#include <boost/test/included/unit_test.hpp>
+
+#include <optional>
+
+#include "memory_budget.hpp"
+
+using server::MemoryBudget;
+
+namespace {
+    // records what acquire_async has handed to the callback
+    struct Waiter {
+        bool called = false;
+        std::optional<MemoryBudget::Lease> lease;
+
+        MemoryBudget::grant_callback_type callback() {
+            return [this](std::optional<MemoryBudget::Lease> granted){
+                called = true;
+                lease = std::move(granted);
+            };
+        }
+
+        [[nodiscard]] bool granted() const { return called && lease.has_value(); }
+        [[nodiscard]] bool rejected() const { return called && !lease.has_value(); }
+    };
+}
+
+BOOST_AUTO_TEST_CASE(release_grants_head_waiter) {
+    MemoryBudget budget {100, 0};
+    auto held = budget.try_acquire(80);
+    BOOST_REQUIRE(held);
+
+    Waiter waiter;
+    budget.acquire_async(50, 0, waiter.callback());
+    BOOST_CHECK(!waiter.called);
+
+    held.reset();
+    BOOST_REQUIRE(waiter.granted());
+    BOOST_CHECK_EQUAL(waiter.lease->size(), 50u);
+}
+
+BOOST_AUTO_TEST_CASE(cancel_of_head_unblocks_next_waiter) {
+    MemoryBudget budget {100, 0};
+    auto held = budget.try_acquire(60);
+    BOOST_REQUIRE(held);
+
+    Waiter head, next;
+    const auto head_ticket = budget.acquire_async(50, 0, head.callback());
+    budget.acquire_async(30, 0, next.callback());
+    // fits, but waits behind the head
+    BOOST_CHECK(!next.called);
+
+    budget.cancel(head_ticket);
+    BOOST_CHECK(!head.called);
+    BOOST_REQUIRE(next.granted());
+    BOOST_CHECK_EQUAL(next.lease->size(), 30u);
+}
+
+BOOST_AUTO_TEST_CASE(try_acquire_fails_while_somebody_waits) {
+    MemoryBudget budget {100, 0};
+    auto held = budget.try_acquire(60);
+    BOOST_REQUIRE(held);
+
+    Waiter waiter;
+    budget.acquire_async(50, 0, waiter.callback());
+    BOOST_CHECK(!budget.try_acquire(10));
+
+    held.reset();
+    BOOST_CHECK(waiter.granted());
+    BOOST_CHECK(budget.try_acquire(10));
+}
+
+BOOST_AUTO_TEST_CASE(small_leases_bypass_queue_within_limit) {
+    MemoryBudget budget {100, 20};
+    auto held = budget.try_acquire(60);
+    BOOST_REQUIRE(held);
+
+    Waiter waiter;
+    budget.acquire_async(50, 0, waiter.callback());
+
+    auto first = budget.try_acquire(10);
+    BOOST_CHECK(first);
+    BOOST_CHECK(!budget.try_acquire(15)); // over the bypass limit
+    auto second = budget.try_acquire(10);
+    BOOST_CHECK(second);
+
+    // the bypassing leases don't keep the head from being granted
+    held.reset();
+    BOOST_CHECK(waiter.granted());
+}
+
+BOOST_AUTO_TEST_CASE(no_bypass_if_head_needs_the_slice) {
+    MemoryBudget budget {100, 20};
+    auto held = budget.try_acquire(10);
+    BOOST_REQUIRE(held);
+
+    Waiter waiter;
+    budget.acquire_async(95, 0, waiter.callback());
+    BOOST_CHECK(!budget.try_acquire(1));
+}
+
+BOOST_AUTO_TEST_CASE(deadlock_rejects_newest_waiter_holding_memory) {
+    MemoryBudget budget {100, 0};
+    auto first_body = budget.try_acquire(30);
+    auto last_body = budget.try_acquire(30);
+    BOOST_REQUIRE(first_body && last_body);
+
+    Waiter first, empty_handed, last;
+    budget.acquire_async(60, 30, first.callback());
+    budget.acquire_async(10, 0, empty_handed.callback());
+    BOOST_CHECK(!first.called);
+    BOOST_CHECK(!empty_handed.called);
+
+    // now all the memory in use belongs to waiters
+    budget.acquire_async(50, 30, last.callback());
+    BOOST_CHECK(last.rejected());
+    BOOST_CHECK(!first.called);
+    BOOST_CHECK(!empty_handed.called);
+
+    // the rejected one gives its memory back, which is enough for the others
+    last_body.reset();
+    BOOST_CHECK(first.granted());
+    BOOST_CHECK(empty_handed.granted());
+}
+
+BOOST_AUTO_TEST_CASE(head_is_rejected_if_nobody_holds_memory) {
+    MemoryBudget budget {100, 0};
+    Waiter waiter;
+    budget.acquire_async(150, 0, waiter.callback());
+    BOOST_CHECK(waiter.rejected());
+    BOOST_CHECK(budget.try_acquire(100));
+}
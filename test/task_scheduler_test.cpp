@@ -0,0 +1,78 @@
+#define BOOST_TEST_MODULE task_scheduler
+#include <boost/test/included/unit_test.hpp>
+
+#include <limits>
+#include <mutex>
+#include <future>
+#include <memory>
+#include <vector>
+
+#include "task_scheduler.hpp"
+
+namespace {
+    constexpr size_t cost_per_second = 1000;
+
+    // posts jobs to a single worker which is kept busy by the first job,
+    // so the rest are queued and the order they are run in is up to the scheduler
+    class OrderRecorder {
+    public:
+        OrderRecorder() {
+            scheduler->post(0, [this](){
+                started.set_value();
+                release.get_future().wait();
+            });
+            started.get_future().wait();
+        }
+
+        void post(size_t cost, int id) {
+            scheduler->post(cost, [this, id](){
+                std::lock_guard lock {mutex};
+                order.push_back(id);
+            });
+        }
+
+        // runs the queued jobs and returns ids in order they were run
+        std::vector<int> finish() {
+            release.set_value();
+            scheduler.reset();
+            return order;
+        }
+
+    private:
+        std::promise<void> started;
+        std::promise<void> release;
+        std::mutex mutex;
+        std::vector<int> order;
+        std::unique_ptr<server::TaskScheduler> scheduler =
+                std::make_unique<server::TaskScheduler>(1, cost_per_second);
+    };
+}
+
+BOOST_AUTO_TEST_CASE(cheap_job_overtakes_expensive_one) {
+    OrderRecorder recorder;
+    recorder.post(100 * cost_per_second, 1);
+    recorder.post(1, 2);
+    const std::vector<int> expected = {2, 1};
+    const auto order = recorder.finish();
+    BOOST_CHECK_EQUAL_COLLECTIONS(order.begin(), order.end(), expected.begin(), expected.end());
+}
+
+BOOST_AUTO_TEST_CASE(equal_cost_jobs_keep_fifo_order) {
+    OrderRecorder recorder;
+    for (int id = 1; id <= 5; id++)
+        recorder.post(cost_per_second, id);
+    const std::vector<int> expected = {1, 2, 3, 4, 5};
+    const auto order = recorder.finish();
+    BOOST_CHECK_EQUAL_COLLECTIONS(order.begin(), order.end(), expected.begin(), expected.end());
+}
+
+// the delay of a huge cost is clamped instead of overflowing the deadline
+BOOST_AUTO_TEST_CASE(huge_cost_is_clamped) {
+    OrderRecorder recorder;
+    recorder.post(std::numeric_limits<size_t>::max(), 1);
+    recorder.post(std::numeric_limits<size_t>::max(), 2);
+    recorder.post(cost_per_second, 3);
+    const std::vector<int> expected = {3, 1, 2};
+    const auto order = recorder.finish();
+    BOOST_CHECK_EQUAL_COLLECTIONS(order.begin(), order.end(), expected.begin(), expected.end());
+}
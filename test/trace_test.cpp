@@ -0,0 +1,103 @@
+#define BOOST_TEST_MODULE trace
+#include <boost/test/included/unit_test.hpp>
+
+#include <map>
+#include <string>
+#include <utility>
+#include <filesystem>
+#include <unistd.h> // getpid
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+#include "util/trace.hpp"
+
+using namespace std::chrono_literals;
+namespace pt = boost::property_tree;
+
+namespace {
+    // trace file in the temporary directory, removed when the test is over
+    struct TraceFile {
+        const std::string path = (std::filesystem::temp_directory_path() /
+                ("trace_test_" + std::to_string(::getpid()) + ".json")).string();
+
+        ~TraceFile() {
+            std::filesystem::remove(path);
+        }
+
+        [[nodiscard]] pt::ptree read() const {
+            pt::ptree events;
+            pt::read_json(path, events); // throws if the file is not valid JSON
+            return events;
+        }
+    };
+}
+
+BOOST_AUTO_TEST_CASE(server_timing_sums_spans_with_same_name) {
+    const auto start = Trace::clock::now();
+    Trace trace;
+    trace.add("read_body", start, start + 1ms);
+    trace.add("body_memory", start + 1ms, start + 3ms);
+    trace.add("read_body", start + 3ms, start + 5ms);
+    trace.add("decode", start + 5ms, start + 5500us);
+
+    BOOST_CHECK_EQUAL(trace.server_timing(), "read_body;dur=3.00, body_memory;dur=2.00, decode;dur=0.50");
+}
+
+BOOST_AUTO_TEST_CASE(server_timing_of_empty_trace) {
+    BOOST_CHECK_EQUAL(Trace {}.server_timing(), "");
+}
+
+BOOST_AUTO_TEST_CASE(chrome_trace_has_balanced_async_events) {
+    TraceFile file;
+    const auto start = Trace::clock::now();
+    {
+        ChromeTraceWriter writer {file.path, 1};
+        for (const char *label : {"first", "second"}) {
+            Trace trace;
+            trace.add("read_body", start, start + 1ms);
+            trace.add("decode", start + 1ms, start + 2ms);
+            trace.add("read_body", start + 2ms, start + 3ms);
+            BOOST_CHECK(writer.write(trace, label));
+        }
+    }
+
+    // per id and name: how many spans began and ended, and the label
+    std::map<std::pair<std::string, std::string>, std::pair<int, int>> spans;
+    std::map<std::string, std::string> labels;
+    for (const auto &[key, event] : file.read()) {
+        BOOST_CHECK(key.empty()); // array element
+        const auto id = event.get<std::string>("id");
+        const auto phase = event.get<std::string>("ph");
+        const auto label = event.get<std::string>("args.request");
+        BOOST_CHECK(labels.emplace(id, label).first->second == label);
+
+        auto &[began, ended] = spans[{id, event.get<std::string>("name")}];
+        if (phase == "b") {
+            began++;
+        } else {
+            BOOST_CHECK_EQUAL(phase, "e");
+            ended++;
+            BOOST_CHECK(ended <= began); // every span ends after it began
+        }
+    }
+
+    BOOST_CHECK_EQUAL(labels.size(), 2u);
+    BOOST_CHECK_EQUAL(spans.size(), 4u);
+    for (const auto &[span, count] : spans) {
+        BOOST_TEST_CONTEXT(span.first << " " << span.second) {
+            BOOST_CHECK_EQUAL(count.first, count.second);
+        }
+    }
+    BOOST_CHECK((spans[{labels.begin()->first, "read_body"}] == std::pair {2, 2}));
+}
+
+BOOST_AUTO_TEST_CASE(chrome_trace_drops_traces_over_queue_limit) {
+    TraceFile file;
+    {
+        ChromeTraceWriter writer {file.path, 1, 0};
+        Trace trace;
+        trace.add("decode", Trace::clock::now());
+        BOOST_CHECK(!writer.write(trace, "dropped"));
+    }
+    BOOST_CHECK(file.read().empty());
+}